@@ -0,0 +1,127 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "symspell.h"
+
+using namespace std::chrono;
+
+// Whole file in memory, no MPI so this measures a single core
+std::string read_file(const char* filename) {
+  std::ifstream in(filename, std::ios::binary);
+  std::stringstream ss;
+  ss << in.rdbuf();
+  return ss.str();
+}
+
+// Checks every word then finds candidates for the misses, like one round of the check stage
+// Candidates go in out so both paths can be compared word by word
+void per_word(Sym_Spell& sym, const Word_Batch& batch, bool* found, std::vector<std::vector<const char*>>& out) {
+  for (int j=0; j<batch.count; j++) {
+    found[j] = sym.check(&batch.data[batch.offsets[j]], batch.lengths[j]);
+  }
+  for (int j=0; j<batch.count; j++) {
+    if (found[j]) continue;
+    out[j] = sym.candidates(&batch.data[batch.offsets[j]], batch.lengths[j]);
+  }
+}
+
+void batched(Sym_Spell& sym, const Word_Batch& batch, bool* found, std::vector<std::vector<const char*>>& out) {
+  sym.check_batch(batch, found);
+  sym.candidates_batch(batch, found, out.data());
+}
+
+// Both paths have to agree on every word, candidate order aside
+int compare(const Word_Batch& batch,
+  const bool* found_a, std::vector<std::vector<const char*>>& out_a,
+  const bool* found_b, std::vector<std::vector<const char*>>& out_b) {
+
+  auto by_text = [](const char* a, const char* b) { return strcmp(a, b) < 0; };
+  int mismatches = 0;
+  for (int j=0; j<batch.count; j++) {
+    bool same = found_a[j] == found_b[j];
+    if (same && !found_a[j]) {
+      std::sort(out_a[j].begin(), out_a[j].end(), by_text);
+      std::sort(out_b[j].begin(), out_b[j].end(), by_text);
+      same = std::equal(out_a[j].begin(), out_a[j].end(), out_b[j].begin(), out_b[j].end(),
+        [](const char* a, const char* b) { return strcmp(a, b) == 0; });
+    }
+    if (!same) {
+      if (mismatches < 10) {
+        printf("Mismatch on \"%s\": per word %s %lu candidates, batched %s %lu candidates\n",
+          &batch.data[batch.offsets[j]],
+          found_a[j] ? "found," : "missed,", out_a[j].size(),
+          found_b[j] ? "found," : "missed,", out_b[j].size());
+      }
+      mismatches++;
+    }
+  }
+  return mismatches;
+}
+
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    std::cout << "Usage: " << argv[0] << " <dictionary> <word_list> [repeats]" << std::endl;
+    return 1;
+  }
+  int repeats = argc > 3 ? atoi(argv[3]) : 5;
+
+  std::string dict_text = read_file(argv[1]);
+  Sym_Spell sym = Sym_Spell(dict_text.data(), dict_text.size());
+
+  // Same layout as a broadcast word list, null terminated words with offsets and lengths
+  std::string words = read_file(argv[2]);
+  auto offsets = std::vector<int>();
+  auto lengths = std::vector<int>();
+  int begin = 0;
+  for (size_t i=0; i<words.size(); i++) {
+    if (words[i] != '\n') continue;
+    words[i] = '\0';
+    offsets.push_back(begin);
+    lengths.push_back(i - begin);
+    begin = i + 1;
+  }
+  Word_Batch batch = {
+    .data = words.data(),
+    .offsets = offsets.data(),
+    .lengths = lengths.data(),
+    .count = (int)offsets.size(),
+  };
+  bool* found = (bool*)calloc(batch.count, sizeof(bool));
+  bool* found_batched = (bool*)calloc(batch.count, sizeof(bool));
+  auto out = std::vector<std::vector<const char*>>(batch.count);
+  auto out_batched = std::vector<std::vector<const char*>>(batch.count);
+
+  // Warm up, this also builds the probe table outside the timed runs
+  per_word(sym, batch, found, out);
+  batched(sym, batch, found_batched, out_batched);
+  int mismatches = compare(batch, found, out, found_batched, out_batched);
+  if (mismatches > 0) {
+    printf("%d of %d words differ between per word and batched\n", mismatches, batch.count);
+    return 1;
+  }
+
+  double best_per_word = 0;
+  double best_batched = 0;
+  for (int r=0; r<repeats; r++) {
+    auto t0 = high_resolution_clock::now();
+    per_word(sym, batch, found, out);
+    auto t1 = high_resolution_clock::now();
+    batched(sym, batch, found_batched, out_batched);
+    auto t2 = high_resolution_clock::now();
+    best_per_word = std::max(best_per_word, batch.count / duration<double>(t1 - t0).count());
+    best_batched = std::max(best_batched, batch.count / duration<double>(t2 - t1).count());
+  }
+
+  printf("words, per_word_qps, batched_qps, speedup\n");
+  printf("%d, %.0f, %.0f, %.2f\n", batch.count, best_per_word, best_batched, best_batched / best_per_word);
+  free(found);
+  free(found_batched);
+  return 0;
+}
@@ -0,0 +1,360 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Phase timers in the order they appear in the results CSVs, missing ones are skipped
+const char* PHASES[] = {"build", "check", "shard_save", "round_save", "segment", "merge", "total"};
+const int NUM_PHASES = sizeof(PHASES) / sizeof(PHASES[0]);
+
+// One run of build/spellcheck, timers are the slowest rank since that's the critical path
+struct Run {
+  int nodes;
+  double phase[NUM_PHASES];
+  bool has_phase[NUM_PHASES];
+  std::string hash;
+  long peak_kb;
+};
+
+// All runs for one dict x words pair, keyed on node count
+struct Series {
+  std::string dict;
+  std::string words;
+  std::map<int, Run> runs;
+};
+
+// T(n) = serial + parallel/n + comm*n
+// comm*n covers each of the n broadcast rounds paying a roughly constant cost
+struct Model {
+  bool ok;
+  double serial;
+  double parallel;
+  double comm;
+};
+
+std::string trim(const std::string& s) {
+  size_t b = s.find_first_not_of(" \t\r\n");
+  size_t e = s.find_last_not_of(" \t\r\n");
+  if (b == std::string::npos) return "";
+  return s.substr(b, e - b + 1);
+}
+
+std::vector<std::string> split(const std::string& line, char sep) {
+  auto out = std::vector<std::string>();
+  std::stringstream ss(line);
+  std::string field;
+  while (std::getline(ss, field, sep)) {
+    out.push_back(trim(field));
+  }
+  return out;
+}
+
+// Older results store timers as "123ms", strtod stops at the suffix either way
+// Runs that restored rounds from checkpoints only time the restore, so they are rejected
+bool read_csv(const std::string& path, Run* run) {
+  std::ifstream in(path);
+  std::string line;
+  if (!std::getline(in, line)) return false;
+
+  auto headings = split(line, ',');
+  int column[NUM_PHASES];
+  for (int p=0; p<NUM_PHASES; p++) {
+    auto it = std::find(headings.begin(), headings.end(), PHASES[p]);
+    column[p] = it == headings.end() ? -1 : it - headings.begin();
+    run->has_phase[p] = column[p] >= 0;
+    run->phase[p] = 0;
+  }
+  auto restored = std::find(headings.begin(), headings.end(), "restored");
+
+  int rows = 0;
+  while (std::getline(in, line)) {
+    auto fields = split(line, ',');
+    if (fields.size() != headings.size()) continue;
+    if (restored != headings.end() && atoi(fields[restored - headings.begin()].c_str()) > 0) return false;
+    for (int p=0; p<NUM_PHASES; p++) {
+      if (column[p] < 0) continue;
+      run->phase[p] = std::max(run->phase[p], strtod(fields[column[p]].c_str(), nullptr));
+    }
+    rows++;
+  }
+  return rows > 0;
+}
+
+// Lines look like "<nodes> <md5>  <output file> <peak> KB"
+void read_hashes(const std::string& path, Series* series) {
+  std::ifstream in(path);
+  std::string line;
+  while (std::getline(in, line)) {
+    std::stringstream ss(line);
+    int nodes;
+    std::string hash;
+    std::string file;
+    long peak_kb = 0;
+    if (!(ss >> nodes >> hash >> file)) continue;
+    ss >> peak_kb;
+    auto it = series->runs.find(nodes);
+    if (it == series->runs.end()) continue;
+    it->second.hash = hash;
+    it->second.peak_kb = peak_kb;
+  }
+}
+
+// Results are named <dict>.<words>.<nodes>.csv with a matching <dict>.<words>.hash.txt
+std::map<std::string, Series> read_results(const std::string& dir) {
+  auto all = std::map<std::string, Series>();
+  for (const auto& entry : std::filesystem::directory_iterator(dir)) {
+    if (entry.path().extension() != ".csv") continue;
+
+    auto parts = split(entry.path().stem().string(), '.');
+    if (parts.size() != 3) continue;
+    char* end;
+    int nodes = strtol(parts[2].c_str(), &end, 10);
+    if (*end != '\0' || nodes <= 0) continue;
+
+    Run run = {};
+    run.nodes = nodes;
+    if (!read_csv(entry.path().string(), &run)) continue;
+
+    std::string key = parts[0] + "." + parts[1];
+    Series& series = all[key];
+    series.dict = parts[0];
+    series.words = parts[1];
+    series.runs[nodes] = run;
+  }
+
+  for (auto& [key, series] : all) {
+    read_hashes(dir + "/" + key + ".hash.txt", &series);
+  }
+  return all;
+}
+
+// Least squares over the chosen terms of {1, 1/n, n} by solving the normal equations
+// Returns the sum of squared residuals, or -1 if the system is singular
+double least_squares(const Series& series, int phase, const bool* use, double* coef) {
+  int cols[3];
+  int k = 0;
+  for (int c=0; c<3; c++) {
+    coef[c] = 0;
+    if (use[c]) cols[k++] = c;
+  }
+
+  double a[3][4] = {};
+  for (const auto& [nodes, run] : series.runs) {
+    double basis[3] = {1.0, 1.0 / nodes, (double)nodes};
+    for (int r=0; r<k; r++) {
+      for (int c=0; c<k; c++) {
+        a[r][c] += basis[cols[r]] * basis[cols[c]];
+      }
+      a[r][k] += basis[cols[r]] * run.phase[phase];
+    }
+  }
+
+  // Gauss-Jordan elimination with partial pivoting
+  for (int c=0; c<k; c++) {
+    int pivot = c;
+    for (int r=c+1; r<k; r++) {
+      if (std::fabs(a[r][c]) > std::fabs(a[pivot][c])) pivot = r;
+    }
+    if (std::fabs(a[pivot][c]) < 1e-12) return -1;
+    std::swap(a[c], a[pivot]);
+    for (int r=0; r<k; r++) {
+      if (r == c) continue;
+      double f = a[r][c] / a[c][c];
+      for (int x=c; x<=k; x++) {
+        a[r][x] -= f * a[c][x];
+      }
+    }
+  }
+  for (int r=0; r<k; r++) {
+    coef[cols[r]] = a[r][k] / a[r][r];
+  }
+
+  double residual = 0;
+  for (const auto& [nodes, run] : series.runs) {
+    double predicted = coef[0] + coef[1] / nodes + coef[2] * nodes;
+    residual += (run.phase[phase] - predicted) * (run.phase[phase] - predicted);
+  }
+  return residual;
+}
+
+// Negative terms have no physical meaning, so every subset of terms is tried
+// and the best fit with all coefficients non-negative wins
+Model fit(const Series& series, int phase) {
+  Model model = {};
+  if (series.runs.size() < 3) return model;
+
+  double best = -1;
+  for (int mask=1; mask<8; mask++) {
+    bool use[3] = {(bool)(mask & 1), (bool)(mask & 2), (bool)(mask & 4)};
+    double coef[3];
+    double residual = least_squares(series, phase, use, coef);
+    if (residual < 0 || coef[0] < 0 || coef[1] < 0 || coef[2] < 0) continue;
+    if (best >= 0 && residual >= best) continue;
+
+    best = residual;
+    model.ok = true;
+    model.serial = coef[0];
+    model.parallel = coef[1];
+    model.comm = coef[2];
+  }
+  return model;
+}
+
+int phase_index(const char* name) {
+  for (int p=0; p<NUM_PHASES; p++) {
+    if (strcmp(PHASES[p], name) == 0) return p;
+  }
+  return -1;
+}
+
+void report(const Series& series) {
+  const int total = phase_index("total");
+  auto base = series.runs.begin();
+
+  printf("== %s x %s ==\n", series.dict.c_str(), series.words.c_str());
+  printf("%6s", "nodes");
+  for (int p=0; p<NUM_PHASES; p++) {
+    if (base->second.has_phase[p]) printf(" %10s", PHASES[p]);
+  }
+  printf(" %8s %8s %9s\n", "speedup", "eff", "peak_kb");
+
+  std::string hash = "";
+  bool hash_mismatch = false;
+  for (const auto& [nodes, run] : series.runs) {
+    double speedup = base->second.phase[total] / std::max(run.phase[total], 1.0) * base->first;
+    double efficiency = speedup / nodes;
+    printf("%6d", nodes);
+    for (int p=0; p<NUM_PHASES; p++) {
+      if (base->second.has_phase[p]) printf(" %10.0f", run.phase[p]);
+    }
+    printf(" %8.2f %8.2f %9ld\n", speedup, efficiency, run.peak_kb);
+
+    if (!run.hash.empty()) {
+      if (!hash.empty() && hash != run.hash) hash_mismatch = true;
+      hash = run.hash;
+    }
+  }
+
+  Model model = fit(series, total);
+  if (model.ok) {
+    printf("model: T(n) = %.0f + %.0f/n + %.1f*n ms\n", model.serial, model.parallel, model.comm);
+    double t1 = model.serial + model.parallel + model.comm;
+    printf("  serial fraction %.1f%%", 100.0 * model.serial / t1);
+    if (model.comm > 0 && model.parallel > 0) {
+      // dT/dn = 0 where parallel/n^2 == comm
+      printf(", broadcast rounds stop paying off past n = %.1f", std::sqrt(model.parallel / model.comm));
+    } else if (model.comm > 0) {
+      // Nothing is split across nodes, every added node only adds a broadcast round
+      printf(", scaling never pays off, T(n) grows from n = 1");
+    } else {
+      printf(", no communication limit within the measured range");
+    }
+    printf("\n");
+  }
+  if (hash_mismatch) {
+    printf("  WARNING: output hash differs between node counts\n");
+  }
+  printf("\n");
+}
+
+// Baseline lines are "<dict>.<words> <nodes> <total ms>"
+std::map<std::pair<std::string, int>, double> read_baseline(const std::string& path) {
+  auto out = std::map<std::pair<std::string, int>, double>();
+  std::ifstream in(path);
+  std::string key;
+  int nodes;
+  double total;
+  while (in >> key >> nodes >> total) {
+    out[{key, nodes}] = total;
+  }
+  return out;
+}
+
+void write_baseline(const std::string& path, const std::map<std::string, Series>& all) {
+  const int total = phase_index("total");
+  std::ofstream out(path);
+  for (const auto& [key, series] : all) {
+    for (const auto& [nodes, run] : series.runs) {
+      out << key << " " << nodes << " " << run.phase[total] << "\n";
+    }
+  }
+}
+
+// A run regresses when its total is more than threshold slower than the baseline
+int check_baseline(
+  const std::map<std::pair<std::string, int>, double>& baseline,
+  const std::map<std::string, Series>& all, double threshold) {
+
+  const int total = phase_index("total");
+  int regressions = 0;
+  for (const auto& [key, series] : all) {
+    for (const auto& [nodes, run] : series.runs) {
+      auto it = baseline.find({key, nodes});
+      if (it == baseline.end() || it->second <= 0) continue;
+      double change = run.phase[total] / it->second - 1.0;
+      if (change > threshold) {
+        printf("REGRESSION %s n=%d: %.0fms -> %.0fms (+%.1f%%)\n",
+          key.c_str(), nodes, it->second, run.phase[total], 100.0 * change);
+        regressions++;
+      }
+    }
+  }
+  return regressions;
+}
+
+int main(int argc, char** argv) {
+  std::string dir = "results";
+  std::string baseline_file = "";
+  std::string save_file = "";
+  double threshold = 0.1;
+
+  bool usage = false;
+  for (int a=1; a<argc && !usage; a++) {
+    if (strcmp(argv[a], "--baseline") == 0 && a + 1 < argc) {
+      baseline_file = argv[++a];
+    } else if (strcmp(argv[a], "--save-baseline") == 0 && a + 1 < argc) {
+      save_file = argv[++a];
+    } else if (strcmp(argv[a], "--threshold") == 0 && a + 1 < argc) {
+      threshold = strtod(argv[++a], nullptr);
+    } else if (argv[a][0] != '-') {
+      dir = argv[a];
+    } else {
+      usage = true;
+    }
+  }
+  if (usage) {
+    std::cout << "Usage: " << argv[0]
+              << " [results_dir] [--baseline <file>] [--save-baseline <file>] [--threshold <fraction>]"
+              << std::endl;
+    return 1;
+  }
+
+  auto all = read_results(dir);
+  if (all.empty()) {
+    std::cout << "No results found in " << dir << std::endl;
+    return 1;
+  }
+
+  for (const auto& [key, series] : all) {
+    report(series);
+  }
+
+  if (!save_file.empty()) {
+    write_baseline(save_file, all);
+  }
+
+  if (!baseline_file.empty()) {
+    auto baseline = read_baseline(baseline_file);
+    int regressions = check_baseline(baseline, all, threshold);
+    printf("%d regression(s) against %s\n", regressions, baseline_file.c_str());
+    return regressions > 0 ? 2 : 0;
+  }
+  return 0;
+}
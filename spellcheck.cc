@@ -7,6 +7,25 @@
 #include <iostream>
 #include <fstream>
 #include <chrono>
+#include <thread>
+
+// Offset of the last newline before the given offset, or -1 if there isn't one
+// Reads backwards a block at a time so lines longer than a partition still work
+MPI_Offset last_newline(MPI_File handle, MPI_Offset before) {
+  const int block = 4096;
+  char buf[block];
+  MPI_Status status;
+  while (before > 0) {
+    MPI_Offset from = std::max((MPI_Offset)0, before - block);
+    int len = before - from;
+    MPI_File_read_at(handle, from, buf, len, MPI_BYTE, &status);
+    for (int k=len-1; k>=0; k--) {
+      if (buf[k] == '\n') return from + k;
+    }
+    before = from;
+  }
+  return -1;
+}
 
 void read_partition(
   const char* filename, int rank, int size, 
@@ -24,21 +43,24 @@ void read_partition(
   MPI_Offset text_len;
 
   MPI_File_get_size(handle, &text_len);
-  int partition = text_len/size;
-  int chunk_size= 2*partition;
+  MPI_Offset partition = text_len/size;
 
-  if (rank == size-1) {
-    int left_over_bytes = text_len - (size*partition);
-    chunk_size += left_over_bytes;
+  // Each node owns the lines whose newline falls inside its partition
+  // The last node also picks up the left over bytes
+  MPI_Offset start = 0;
+  if (rank != 0) {
+    start = last_newline(handle, rank*partition) + 1;
+  }
+  MPI_Offset end = text_len;
+  if (rank != size-1) {
+    end = (rank+1)*partition;
   }
+  end = last_newline(handle, end) + 1;
+  end = std::max(start, end);
 
+  int chunk_size = end - start;
   char* dict_text = (char*)malloc(sizeof(char)*chunk_size);
-
-  if (rank == 0) {
-    MPI_File_read_at(handle, 0, dict_text, chunk_size, MPI_BYTE, &status);
-  } else {
-    MPI_File_read_at(handle, (rank-1)*partition, dict_text, chunk_size, MPI_BYTE, &status);
-  }
+  MPI_File_read_at(handle, start, dict_text, chunk_size, MPI_BYTE, &status);
 
   if(MPI_File_close(&handle) != MPI_SUCCESS) {
       printf("[MPI process %d] Failure in closing the file.\n", rank);
@@ -47,45 +69,30 @@ void read_partition(
 
   // printf("[MPI process %d] File closed successfully.\n", rank);
 
-  size_t start;
-  size_t end;
-  if (rank == 0) {
-    start = 0;
-    end = partition-1;
-  } else { 
-    start = partition;
-    end = chunk_size-1;
-  }
-
-  // Find the beginning of the first word in our list
-  if (rank != 0) {
-    start--;
-    while(dict_text[start] != '\n') {
-      start--;
-    }
-    start++;
-  }
-
-  // Find the end of the last word in our list
-  while(dict_text[end] != '\n') {
-    end--;
-  }
-
   // Calculate final total buffer
-  *list_size = end - start + 1;
-  *begin = &dict_text[start];
+  *list_size = chunk_size;
+  *begin = dict_text;
   *data = dict_text;
 }
 
-Sym_Spell sym_spell_partition(const char* filename, int rank, int size) {
+Sym_Spell sym_spell_partition(const char* filename, int rank, int size, bool utf8, const char* shard) {
   char* data;
   char* begin;
   size_t list_len;
   // Read the file
   read_partition(filename, rank, size, &data, &begin, &list_len);
 
+  // Reuse the index built by an earlier run over the same partition
+  if (shard) {
+    Sym_Spell smp = Sym_Spell("", 0, utf8);
+    if (smp.load(shard, begin, list_len)) {
+      free(data);
+      return smp;
+    }
+  }
+
   // Put data into sym_spell data structure
-  Sym_Spell smp = Sym_Spell(begin, list_len);
+  Sym_Spell smp = Sym_Spell(begin, list_len, utf8);
   free(data);
   return smp;
 }
@@ -120,25 +127,403 @@ Word_List word_list_partition(const char* filename, int rank, int size) {
   return word_list;
 }
 
+// Collapse runs of whitespace in every line into single spaces, which mark the input's word boundaries
+void normalise_lines(Word_List* list) {
+  size_t w = 0;
+  size_t r = 0;
+  for (size_t j=0; j<list->lengths.size(); j++) {
+    int len = 0;
+    for (int k=0; k<list->lengths[j]; k++) {
+      char c = list->data[r + k];
+      if (c == ' ' || c == '\t' || c == '\r') {
+        if (len > 0 && list->data[w - 1] != ' ') {
+          list->data[w++] = ' ';
+          len++;
+        }
+        continue;
+      }
+      list->data[w++] = c;
+      len++;
+    }
+    if (len > 0 && list->data[w - 1] == ' ') {
+      w--;
+      len--;
+    }
+    list->data[w++] = '\0';
+    r += list->lengths[j] + 1;
+    list->lengths[j] = len;
+  }
+  list->data_len = w;
+}
+
+// Drops the spaces and the punctuation around words from a line, leaving the text to segment
+// bounds marks where words started plus both ends, glue keeps what was cut out at each boundary
+// Punctuation makes a hard boundary, so words either side of it are never joined
+void split_line(const char* line, int len, std::string* text, std::string* bounds, std::vector<std::string>* glue) {
+  text->clear();
+  bounds->assign(1, SEGMENT_SOFT);
+  glue->assign(1, "");
+  int k = 0;
+  while (k < len) {
+    int end = k;
+    while (end < len && line[end] != ' ') end++;
+    int word_begin = k;
+    int word_end = end;
+    while (word_begin < word_end && ispunct((unsigned char)line[word_begin])) word_begin++;
+    while (word_end > word_begin && ispunct((unsigned char)line[word_end - 1])) word_end--;
+
+    // A word of only punctuation is all glue
+    if (word_begin == word_end) {
+      glue->back().append(&line[k], end - k);
+    } else {
+      glue->back().append(&line[k], word_begin - k);
+      bounds->back() = glue->back() == " " ? SEGMENT_SOFT : SEGMENT_HARD;
+      text->append(&line[word_begin], word_end - word_begin);
+      bounds->resize(text->size() + 1, 0);
+      glue->resize(text->size() + 1);
+      glue->back().append(&line[word_end], end - word_end);
+    }
+    if (end < len) glue->back().push_back(' ');
+    k = end + 1;
+  }
+  bounds->back() = SEGMENT_SOFT;
+}
+
+// Keep whichever candidate sorts first, empty slots lose
+void min_word(void* in, void* inout, int* len, MPI_Datatype* type) {
+  char* a = (char*)in;
+  char* b = (char*)inout;
+  for (int k=0; k<*len; k++) {
+    char* x = &a[k*SEGMENT_SLOT];
+    char* y = &b[k*SEGMENT_SLOT];
+    if (x[0] == '\0') continue;
+    if (y[0] == '\0' || word_order(x, y) < 0) {
+      memcpy(y, x, SEGMENT_SLOT);
+    }
+  }
+}
+
+// Splits and joins words in free text, one line of text at a time
+// Runs the same broadcast rounds as the check stage, writing text_segmented.txt to results_dir on rank 0
+void segment_text(const char* filename, const char* results_dir, Sym_Spell& sym, int rank, int size) {
+  Word_List text = word_list_partition(filename, rank, size);
+  normalise_lines(&text);
+
+  int text_size = text.data_len;
+  int text_count = text.lengths.size();
+  int text_sizes[size];
+  int text_counts[size];
+  MPI_Allgather(&text_size, 1, MPI_INT, text_sizes, 1, MPI_INT, MPI_COMM_WORLD);
+  MPI_Allgather(&text_count, 1, MPI_INT, text_counts, 1, MPI_INT, MPI_COMM_WORLD);
+
+  int max_text_size = 0;
+  int max_text_count = 0;
+  for (int i=0; i<size; i++) {
+    max_text_size = std::max(max_text_size, text_sizes[i]);
+    max_text_count = std::max(max_text_count, text_counts[i]);
+  }
+
+  char* other_text = (char*)calloc(max_text_size, sizeof(char));
+  int* other_lengths = (int*)calloc(max_text_count, sizeof(int));
+
+  // One cost per (start, length) pair for every byte of text
+  unsigned char* local_costs = (unsigned char*)malloc(max_text_size*SEGMENT_MAX_LEN*sizeof(unsigned char));
+  unsigned char* global_costs = (unsigned char*)malloc(max_text_size*SEGMENT_MAX_LEN*sizeof(unsigned char));
+
+  MPI_Datatype slot_type;
+  MPI_Type_contiguous(SEGMENT_SLOT, MPI_CHAR, &slot_type);
+  MPI_Type_commit(&slot_type);
+  MPI_Op min_word_op;
+  MPI_Op_create(min_word, 1, &min_word_op);
+
+  std::vector<char> lines = std::vector<char>();
+  std::string buf;
+
+  for (int i=0; i<size; i++) {
+    char* curr_text;
+    int* curr_lengths;
+
+    if (rank == i) {
+      MPI_Bcast(text.data, text.data_len, MPI_CHAR, i, MPI_COMM_WORLD);
+      MPI_Bcast(text.lengths.data(), text.lengths.size(), MPI_INT, i, MPI_COMM_WORLD);
+      curr_text = text.data;
+      curr_lengths = text.lengths.data();
+    } else {
+      MPI_Bcast(other_text, text_sizes[i], MPI_CHAR, i, MPI_COMM_WORLD);
+      MPI_Bcast(other_lengths, text_counts[i], MPI_INT, i, MPI_COMM_WORLD);
+      curr_text = other_text;
+      curr_lengths = other_lengths;
+    }
+
+    int num_lines = text_counts[i];
+    int num_costs = text_sizes[i]*SEGMENT_MAX_LEN;
+    memset(local_costs, LOOKUP_NONE, num_costs*sizeof(unsigned char));
+
+    // Segmentation works on each line with its spaces and punctuation taken out
+    // A line never grows, so its costs still fit at its offset in the broadcast text
+    auto line_text = std::vector<std::string>(num_lines);
+    auto line_bounds = std::vector<std::string>(num_lines);
+    auto line_glue = std::vector<std::vector<std::string>>(num_lines);
+    auto line_offset = std::vector<int>(num_lines);
+    int accum = 0;
+    for (int j=0; j<num_lines; j++) {
+      split_line(&curr_text[accum], curr_lengths[j], &line_text[j], &line_bounds[j], &line_glue[j]);
+      line_offset[j] = accum;
+      accum += curr_lengths[j] + 1;
+    }
+
+    // Look up every substring of every line in this node's dictionary
+    for (int j=0; j<num_lines; j++) {
+      const char* line = line_text[j].data();
+      const char* bounds = line_bounds[j].data();
+      int len = line_text[j].size();
+      int accum = line_offset[j];
+      for (int b=0; b<len; b++) {
+        if (sym.utf8 && ((unsigned char)line[b] & 0xC0) == 0x80) continue;
+        for (int n=1; n<=SEGMENT_MAX_LEN && b + n <= len; n++) {
+          // Segments never cross punctuation
+          if (n > 1 && bounds[b + n - 1] == SEGMENT_HARD) break;
+          if (sym.utf8 && b + n < len && ((unsigned char)line[b + n] & 0xC0) == 0x80) continue;
+          buf.assign(&line[b], n);
+          local_costs[(accum + b)*SEGMENT_MAX_LEN + n - 1] = sym.lookup(buf.c_str(), n, nullptr);
+        }
+      }
+    }
+
+    MPI_Allreduce(local_costs, global_costs, num_costs, MPI_UNSIGNED_CHAR, MPI_MIN, MPI_COMM_WORLD);
+
+    // Every node runs the same segmentation so they agree on which segments need a correction
+    std::vector<std::vector<Segment>> segments = std::vector<std::vector<Segment>>(num_lines);
+    int num_edits = 0;
+    for (int j=0; j<num_lines; j++) {
+      segments[j] = segment(
+        line_text[j].data(), line_text[j].size(),
+        &global_costs[line_offset[j]*SEGMENT_MAX_LEN], line_bounds[j].data(), sym.utf8);
+      for (Segment seg : segments[j]) {
+        if (seg.cost == LOOKUP_EDIT) num_edits++;
+      }
+    }
+
+    // Propose this node's best correction for each edited segment
+    char* send_slots = (char*)calloc(num_edits*SEGMENT_SLOT, sizeof(char));
+    char* recv_slots = (char*)calloc(num_edits*SEGMENT_SLOT, sizeof(char));
+    int slot = 0;
+    for (int j=0; j<num_lines; j++) {
+      for (Segment seg : segments[j]) {
+        if (seg.cost != LOOKUP_EDIT) continue;
+        const char* best;
+        buf.assign(&line_text[j][seg.begin], seg.len);
+
+        // SEGMENT_SLOT fits any correction of a segment, never write a truncated one
+        if (sym.lookup(buf.c_str(), seg.len, &best) == LOOKUP_EDIT && strlen(best) < SEGMENT_SLOT) {
+          strcpy(&send_slots[slot*SEGMENT_SLOT], best);
+        }
+        slot++;
+      }
+    }
+
+    MPI_Reduce(send_slots, recv_slots, num_edits, slot_type, min_word_op, i, MPI_COMM_WORLD);
+
+    if (rank == i) {
+      // "segmented words with corrections\n", with the original spacing and punctuation between them
+      // An added boundary gets a single space, a removed one drops its space
+      slot = 0;
+      for (int j=0; j<num_lines; j++) {
+        const std::vector<std::string>& glue = line_glue[j];
+        for (Segment seg : segments[j]) {
+          const std::string& before = seg.begin == 0 || line_bounds[j][seg.begin] ? glue[seg.begin] : " ";
+          lines.insert(lines.end(), before.begin(), before.end());
+
+          // Falls back to the segment as written when no node had a correction that fit
+          const char* word = &line_text[j][seg.begin];
+          size_t word_len = seg.len;
+          if (seg.cost == LOOKUP_EDIT) {
+            if (recv_slots[slot*SEGMENT_SLOT] != '\0') {
+              word = &recv_slots[slot*SEGMENT_SLOT];
+              word_len = strlen(word);
+            }
+            slot++;
+          }
+          lines.insert(lines.end(), word, word + word_len);
+        }
+        lines.insert(lines.end(), glue.back().begin(), glue.back().end());
+        lines.push_back('\n');
+      }
+    }
+
+    free(send_slots);
+    free(recv_slots);
+  }
+
+  // Partitions are contiguous so gathering in rank order keeps the original line order
+  int lines_size = lines.size();
+  int line_size_at_rank[size];
+  MPI_Gather(&lines_size, 1, MPI_INT, line_size_at_rank, 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+  if (rank == 0) {
+    std::ofstream out(std::string(results_dir) + "/text_segmented.txt");
+    out.write(lines.data(), lines.size());
+    std::vector<char> other_lines;
+    for (int i=1; i<size; i++) {
+      other_lines.resize(line_size_at_rank[i]);
+      MPI_Recv(other_lines.data(), line_size_at_rank[i], MPI_CHAR, i, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+      out.write(other_lines.data(), other_lines.size());
+    }
+    out.close();
+  } else {
+    MPI_Send(lines.data(), lines.size(), MPI_CHAR, 0, 0, MPI_COMM_WORLD);
+  }
+
+  MPI_Op_free(&min_word_op);
+  MPI_Type_free(&slot_type);
+  free(local_costs);
+  free(global_costs);
+  free(other_text);
+  free(other_lengths);
+  free(text.data);
+}
+
+// Checkpoint files are keyed on the number of nodes since that decides the partitions
+std::string checkpoint_path(const char* dir, const char* name, int size, int index) {
+  return std::string(dir) + "/" + name + "." + std::to_string(size) + "." + std::to_string(index) + ".bin";
+}
+
+#define ROUND_MAGIC 0x524e4452u
+
+// Written by the owner of a round once its output lines are complete
+// Goes through a temporary file so a node dying mid write never leaves a partial checkpoint
+bool save_round(
+  const std::string& path, size_t tag,
+  int misspelt_words, const int* candidate_counts, const std::vector<char>& lines) {
+
+  std::string tmp = path + ".tmp";
+  FILE* f = fopen(tmp.c_str(), "wb");
+  if (!f) return false;
+
+  uint32_t magic = ROUND_MAGIC;
+  uint64_t lines_size = lines.size();
+  bool ok = fwrite(&magic, sizeof(magic), 1, f) == 1;
+  ok = ok && fwrite(&tag, sizeof(tag), 1, f) == 1;
+  ok = ok && fwrite(&misspelt_words, sizeof(int), 1, f) == 1;
+  ok = ok && fwrite(candidate_counts, sizeof(int), misspelt_words, f) == (size_t)misspelt_words;
+  ok = ok && fwrite(&lines_size, sizeof(lines_size), 1, f) == 1;
+  ok = ok && fwrite(lines.data(), sizeof(char), lines.size(), f) == lines.size();
+  ok = (fclose(f) == 0) && ok;
+
+  if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+    remove(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool load_round(
+  const std::string& path, size_t tag,
+  int* misspelt_words, int** candidate_counts, std::vector<char>* lines) {
+
+  FILE* f = fopen(path.c_str(), "rb");
+  if (!f) return false;
+
+  uint32_t magic = 0;
+  size_t saved_tag = 0;
+  int count = 0;
+  bool ok = fread(&magic, sizeof(magic), 1, f) == 1;
+  ok = ok && fread(&saved_tag, sizeof(saved_tag), 1, f) == 1;
+  ok = ok && magic == ROUND_MAGIC && saved_tag == tag;
+  ok = ok && fread(&count, sizeof(int), 1, f) == 1 && count >= 0;
+  if (!ok) {
+    fclose(f);
+    return false;
+  }
+
+  int* counts = (int*)calloc(count, sizeof(int));
+  uint64_t lines_size = 0;
+  ok = fread(counts, sizeof(int), count, f) == (size_t)count;
+  ok = ok && fread(&lines_size, sizeof(lines_size), 1, f) == 1;
+  if (ok) {
+    lines->resize(lines_size);
+    ok = fread(lines->data(), sizeof(char), lines_size, f) == lines_size;
+  }
+  fclose(f);
+
+  if (!ok) {
+    free(counts);
+    lines->clear();
+    return false;
+  }
+  *misspelt_words = count;
+  *candidate_counts = counts;
+  return true;
+}
+
 using namespace std::chrono;
 
 int main(int argc, char** argv) {
-  if (argc != 3) {
-    std::cout << "Usage: " << argv[0] << " <dictionary> <word_list>" << std::endl;
+  bool utf8 = false;
+  const char* text_file = nullptr;
+  const char* checkpoint_dir = nullptr;
+  const char* results_dir = "results";
+  bool usage = argc < 3;
+  for (int a=3; a<argc && !usage; a++) {
+    if (strcmp(argv[a], "--utf8") == 0) {
+      utf8 = true;
+    } else if (strcmp(argv[a], "--segment") == 0 && a + 1 < argc) {
+      text_file = argv[++a];
+    } else if (strcmp(argv[a], "--checkpoint") == 0 && a + 1 < argc) {
+      checkpoint_dir = argv[++a];
+    } else if (strcmp(argv[a], "--results") == 0 && a + 1 < argc) {
+      results_dir = argv[++a];
+    } else {
+      usage = true;
+    }
+  }
+  if (usage) {
+    std::cout << "Usage: " << argv[0] << " <dictionary> <word_list> [--utf8] [--segment <text>] [--checkpoint <dir>] [--results <dir>]" << std::endl;
     return 1;
   }
 
   auto start = high_resolution_clock::now(); // Start timing
 
   // Initialise MPI
-  MPI_Init(&argc, &argv);
+  // Only the main thread calls MPI, the shard save thread just writes a file
+  int provided;
+  MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
   int rank;
   MPI_Comm_rank(MPI_COMM_WORLD, &rank);
   int size;
   MPI_Comm_size(MPI_COMM_WORLD, &size);
 
+  // Time spent writing checkpoints, reported separately
+  // The shard save runs alongside the rounds, only waiting for it is counted in check, under round_save
+  milliseconds shard_save_time = milliseconds(0);
+  milliseconds round_save_time = milliseconds(0);
+
   // Build out sym spell data structure
-  Sym_Spell sym = sym_spell_partition(argv[1], rank, size);
+  std::string shard;
+  if (checkpoint_dir) {
+    shard = checkpoint_path(checkpoint_dir, "shard", size, rank);
+  }
+  Sym_Spell sym = sym_spell_partition(argv[1], rank, size, utf8, checkpoint_dir ? shard.c_str() : nullptr);
+
+  // Save the index for a restart unless it was just loaded from there
+  // Nothing modifies the index after this, so the save overlaps the rounds on its own thread
+  // It's joined before the round file is written, so a restorable round always has its shard
+  std::thread shard_saver;
+  if (checkpoint_dir && !sym.loaded) {
+    shard_saver = std::thread([&sym, &shard, &shard_save_time, rank]() {
+      auto checkpoint_start = high_resolution_clock::now();
+      if (!sym.save(shard.c_str())) {
+        printf("[MPI process %d] Failure in saving the index to %s.\n", rank, shard.c_str());
+      }
+      shard_save_time = duration_cast<milliseconds>(high_resolution_clock::now() - checkpoint_start);
+    });
+  }
+  auto join_shard_saver = [&]() {
+    if (!shard_saver.joinable()) return;
+    auto wait_start = high_resolution_clock::now();
+    shard_saver.join();
+    round_save_time += duration_cast<milliseconds>(high_resolution_clock::now() - wait_start);
+  };
   int count = sym.dict.size();
   int word_count;
   std::string out = std::string();
@@ -150,7 +535,7 @@ int main(int argc, char** argv) {
     auto time = setup_time;
     auto duration = duration_cast<milliseconds>(setup_time - start).count();
     auto milliseconds = duration % 1000;
-    out += std::to_string(duration); out += "ms"; out += ", ";
+    out += std::to_string(duration); out += ", ";
     out += std::to_string(sym.dict.size()); out += ", ";
     out += std::to_string(sym.map.size()); out += ", ";
     out += std::to_string(sym.map.size() / (double) sym.dict.size()); out += ", ";
@@ -203,6 +588,9 @@ int main(int argc, char** argv) {
   int* local_byte_counts = (int*)malloc((max_list_count*size)*sizeof(int));
   int* global_byte_counts = (int*)malloc((max_list_count*size)*sizeof(int));
 
+  // byte offset of each word in the list being checked
+  int* word_offsets = (int*)malloc(max_list_count*sizeof(int));
+
   // sendiing and receiving candidate words for each node
   char* send_buffer = (char*)malloc(max_list_length*sizeof(char)); 
   char* recv_buffer = (char*)malloc(max_list_length*sizeof(char)); 
@@ -212,8 +600,35 @@ int main(int argc, char** argv) {
   int misspelt_words;
   std::vector<char> lines = std::vector<char>();
 
+  // Rounds whose owners already checkpointed their output lines are skipped
+  // A round's output depends on every node's dictionary partition, so the tag combines all of them
+  // with this node's word list and the lookup mode
+  int first_round = 0;
+  size_t round_tag = 0;
+  if (checkpoint_dir) {
+    unsigned long long dict_tag = fnv_hash_bytes(FNV_OFFSET_BASIS, sym.data, sym.filesize);
+    unsigned long long dict_tags[size];
+    MPI_Allgather(&dict_tag, 1, MPI_UNSIGNED_LONG_LONG, dict_tags, 1, MPI_UNSIGNED_LONG_LONG, MPI_COMM_WORLD);
+    round_tag = fnv_hash_bytes(FNV_OFFSET_BASIS, (const char*)dict_tags, sizeof(dict_tags));
+    round_tag = fnv_hash_bytes(round_tag, (const char*)&utf8, sizeof(utf8));
+    round_tag = fnv_hash_bytes(round_tag, word_list.data, word_list.data_len);
+
+    int done = load_round(
+      checkpoint_path(checkpoint_dir, "round", size, rank), round_tag,
+      &misspelt_words, &candidate_counts, &lines);
+    int round_done[size];
+    MPI_Allgather(&done, 1, MPI_INT, round_done, 1, MPI_INT, MPI_COMM_WORLD);
+    while (first_round < size && round_done[first_round]) first_round++;
+
+    // Later rounds get redone so their output can't be duplicated
+    if (done && rank >= first_round) {
+      free(candidate_counts);
+      lines.clear();
+    }
+  }
+
   // Fill out lines dictionary
-  for (int i=0; i<size; i++) {
+  for (int i=first_round; i<size; i++) {
     memset(global_byte_counts, 0, (max_list_count*size)*sizeof(int));
     memset(local_byte_counts, 0, (max_list_count*size)*sizeof(int));
     memset(local_word_check, 0, (max_list_count)*sizeof(bool));
@@ -233,25 +648,31 @@ int main(int argc, char** argv) {
 
     int num_words = word_list_counts[i];
 
+    // Words are queried as one batch of offsets and lengths
     int accum = 0;
     for (int j=0; j<num_words; j++) {
-      local_word_check[j] = sym.check(&curr_words[accum], curr_lengths[j]);
+      word_offsets[j] = accum;
       accum += curr_lengths[j] + 1;
     }
+    Word_Batch batch = {
+      .data = curr_words,
+      .offsets = word_offsets,
+      .lengths = curr_lengths,
+      .count = num_words,
+    };
+
+    sym.check_batch(batch, local_word_check);
 
     MPI_Allreduce(local_word_check, global_word_check, num_words, MPI_CXX_BOOL, MPI_LOR, MPI_COMM_WORLD);
     
     // Map stored words to candidate strings
-    accum = 0;
-    auto map = std::unordered_map<int, std::vector<const char*>>();
+    // Only for words that don't exist anywhere
+    auto map = std::vector<std::vector<const char*>>(num_words);
+    sym.candidates_batch(batch, global_word_check, map.data());
     for (int j=0; j<num_words; j++) {
 
-      // Only if the word doesn't exist anywhere
       if (!global_word_check[j]) {
 
-        // {words, thing, hi}
-        map[j] = sym.candidates(&curr_words[accum], curr_lengths[j]);
-
         // {words, thing, hi}
         for (const char* c : map[j]) {
 
@@ -263,7 +684,6 @@ int main(int argc, char** argv) {
           local_byte_counts[j*size + rank] += word_len * sizeof(char); 
         } 
       }
-      accum += curr_lengths[j] + 1;
     }
 
     // essentially just gathering the byte counts from each node
@@ -401,16 +821,38 @@ int main(int argc, char** argv) {
       accum += word_len + 1;
       candidates.clear();
     }
+
+    if (checkpoint_dir) {
+      join_shard_saver();
+      auto checkpoint_start = high_resolution_clock::now();
+      std::string round = checkpoint_path(checkpoint_dir, "round", size, rank);
+      if (!save_round(round, round_tag, misspelt_words, candidate_counts, lines)) {
+        printf("[MPI process %d] Failure in saving the round to %s.\n", rank, round.c_str());
+      }
+      round_save_time += duration_cast<milliseconds>(high_resolution_clock::now() - checkpoint_start);
+    }
   }
 
   auto parallel_processing_time = high_resolution_clock::now();
   {
     auto duration = duration_cast<milliseconds>(parallel_processing_time - setup_time).count();
     auto milliseconds = duration % 1000;
-    out += std::to_string(duration); out += "ms" ; out += ", ";
+    out += std::to_string(duration); out += ", ";
+    out += std::to_string(shard_save_time.count()); out += ", ";
+    out += std::to_string(round_save_time.count()); out += ", ";
+    out += std::to_string(first_round); out += ", ";
   }
 
-  const char* out_filename = "results/word_list_misspelled.txt";
+  // Segmentation of free text, skipped unless a text file was given
+  if (text_file) {
+    segment_text(text_file, results_dir, sym, rank, size);
+  }
+
+  auto segment_time = high_resolution_clock::now();
+  {
+    auto duration = duration_cast<milliseconds>(segment_time - parallel_processing_time).count();
+    out += std::to_string(duration); out += ", ";
+  }
 
   int lines_size = lines.size();
   int line_size_at_rank[size];
@@ -475,7 +917,7 @@ int main(int argc, char** argv) {
       return lhs.word_count < rhs.word_count;
     });
     
-    std::ofstream out("results/word_list_misspelled.txt");
+    std::ofstream out(std::string(results_dir) + "/word_list_misspelled.txt");
     for (Line line : output_lines) {
 		  if (line.line == "\n") continue; // dumb bug ig
       out << line.line;
@@ -490,9 +932,9 @@ int main(int argc, char** argv) {
   // Gather time
   auto gather_time = high_resolution_clock::now();
   {
-    auto duration = duration_cast<milliseconds>(gather_time - parallel_processing_time).count();
+    auto duration = duration_cast<milliseconds>(gather_time - segment_time).count();
     auto milliseconds = duration % 1000;
-    out += std::to_string(duration); out += "ms" ; out += ", ";
+    out += std::to_string(duration); out += ", ";
   }
 
   // Show wall time
@@ -500,7 +942,7 @@ int main(int argc, char** argv) {
   {
     auto duration = duration_cast<milliseconds>(time - start).count();
     auto milliseconds = duration % 1000;
-    out += std::to_string(duration); out += "ms"; out += "\n";
+    out += std::to_string(duration); out += "\n";
   }
   std::cout << out;
 
@@ -512,6 +954,7 @@ int main(int argc, char** argv) {
   free(global_word_check);
   free(other_words);
   free(other_lengths);
+  free(word_offsets);
   free(global_byte_counts);
   free(local_byte_counts);
   MPI_Finalize();
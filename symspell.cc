@@ -3,7 +3,13 @@
 #include <algorithm>
 #include "symspell.h"
 #include <cstring>
+#include <strings.h>
 #include <iostream>
+#include <string_view>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 size_t fnv_hash(size_t prev_hash, char const* letter) {
   while (*letter) {
@@ -13,7 +19,231 @@ size_t fnv_hash(size_t prev_hash, char const* letter) {
   return prev_hash % (UINT64_MAX / 2);
 }
 
-Sym_Spell::Sym_Spell(const char* dict_text, size_t text_len) {
+// Same hash as above over a buffer that may contain null bytes
+size_t fnv_hash_bytes(size_t prev_hash, char const* bytes, size_t len) {
+  for (size_t i=0; i<len; i++) {
+    prev_hash ^= bytes[i];
+    prev_hash *= FNV_PRIME;
+  }
+  return prev_hash % (UINT64_MAX / 2);
+}
+
+// Scans 16 bytes at a time for any byte with the high bit set
+bool ascii_only(const char* s, size_t len) {
+    size_t i = 0;
+#ifdef __SSE2__
+    for (; i + 16 <= len; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)&s[i]);
+        if (_mm_movemask_epi8(chunk)) return false;
+    }
+#endif
+    for (; i < len; i++) {
+        if ((unsigned char)s[i] & 0x80) return false;
+    }
+    return true;
+}
+
+// Invalid bytes decode to U+DC80..U+DCFF so they still compare as distinct characters
+static size_t utf8_invalid(const unsigned char* u, uint32_t* cp) {
+    *cp = 0xDC00 | u[0];
+    return 1;
+}
+
+// Returns the number of bytes consumed, always at least 1
+size_t utf8_decode(const char* s, size_t len, uint32_t* cp) {
+    const unsigned char* u = (const unsigned char*)s;
+    if (u[0] < 0x80) {
+        *cp = u[0];
+        return 1;
+    }
+
+    size_t n;
+    uint32_t min;
+    uint32_t c;
+    if ((u[0] & 0xE0) == 0xC0) {
+        n = 2; min = 0x80; c = u[0] & 0x1F;
+    } else if ((u[0] & 0xF0) == 0xE0) {
+        n = 3; min = 0x800; c = u[0] & 0x0F;
+    } else if ((u[0] & 0xF8) == 0xF0) {
+        n = 4; min = 0x10000; c = u[0] & 0x07;
+    } else {
+        return utf8_invalid(u, cp);
+    }
+
+    if (n > len) return utf8_invalid(u, cp);
+    for (size_t k=1; k<n; k++) {
+        if ((u[k] & 0xC0) != 0x80) return utf8_invalid(u, cp);
+        c = (c << 6) | (u[k] & 0x3F);
+    }
+
+    // Overlong encodings, surrogates and out of range codepoints
+    if (c < min || c > 0x10FFFF || (c >= 0xD800 && c <= 0xDFFF)) {
+        return utf8_invalid(u, cp);
+    }
+    *cp = c;
+    return n;
+}
+
+size_t utf8_encode(uint32_t cp, char* out) {
+    if (cp < 0x80) {
+        out[0] = cp;
+        return 1;
+    }
+    if (cp < 0x800) {
+        out[0] = 0xC0 | (cp >> 6);
+        out[1] = 0x80 | (cp & 0x3F);
+        return 2;
+    }
+    if (cp < 0x10000) {
+        out[0] = 0xE0 | (cp >> 12);
+        out[1] = 0x80 | ((cp >> 6) & 0x3F);
+        out[2] = 0x80 | (cp & 0x3F);
+        return 3;
+    }
+    out[0] = 0xF0 | (cp >> 18);
+    out[1] = 0x80 | ((cp >> 12) & 0x3F);
+    out[2] = 0x80 | ((cp >> 6) & 0x3F);
+    out[3] = 0x80 | (cp & 0x3F);
+    return 4;
+}
+
+bool utf8_valid(const char* s, size_t len) {
+    size_t i = 0;
+    while (i < len) {
+#ifdef __SSE2__
+        // Skip over runs of ASCII
+        if (i + 16 <= len) {
+            __m128i chunk = _mm_loadu_si128((const __m128i*)&s[i]);
+            if (!_mm_movemask_epi8(chunk)) {
+                i += 16;
+                continue;
+            }
+        }
+#endif
+        uint32_t cp;
+        size_t n = utf8_decode(&s[i], len - i, &cp);
+        if (n == 1 && ((unsigned char)s[i] & 0x80)) return false;
+        i += n;
+    }
+    return true;
+}
+
+// One pass over a dictionary buffer, flagging the start of every valid word with non-ASCII bytes
+// ASCII is skipped 16 bytes at a time, only words holding a high byte get decoded
+static void mark_wide_words(const char* s, size_t len, std::vector<bool>& wide) {
+    auto separator = [](char c) { return c == '\0' || c == '\n'; };
+    size_t i = 0;
+    while (i < len) {
+#ifdef __SSE2__
+        if (i + 16 <= len) {
+            int mask = _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)&s[i]));
+            if (!mask) {
+                i += 16;
+                continue;
+            }
+            i += __builtin_ctz(mask);
+        }
+#endif
+        if (!((unsigned char)s[i] & 0x80)) {
+            i++;
+            continue;
+        }
+
+        size_t begin = i;
+        while (begin > 0 && !separator(s[begin - 1])) begin--;
+        size_t end = i;
+        while (end < len && !separator(s[end])) end++;
+        if (utf8_valid(&s[begin], end - begin)) wide[begin] = true;
+        i = end;
+    }
+}
+
+// Simple uppercase mapping for Latin-1, Latin Extended-A, Greek and Cyrillic
+// Greek includes the tonos and dialytika letters, ΐ and ΰ have no single uppercase so they stay
+uint32_t unicode_upper(uint32_t cp) {
+    if (cp < 0x80) return toupper(cp);
+    if (cp >= 0xE0 && cp <= 0xFE && cp != 0xF7) return cp - 0x20;
+    if (cp == 0xFF) return 0x178;
+    if (cp >= 0x100 && cp <= 0x137 && (cp & 1)) return cp - 1;
+    if (cp >= 0x139 && cp <= 0x148 && !(cp & 1)) return cp - 1;
+    if (cp >= 0x14A && cp <= 0x177 && (cp & 1)) return cp - 1;
+    if (cp >= 0x179 && cp <= 0x17E && !(cp & 1)) return cp - 1;
+    if (cp == 0x3AC) return 0x386;
+    if (cp >= 0x3AD && cp <= 0x3AF) return cp - 0x25;
+    if (cp == 0x3C2) return 0x3A3;
+    if (cp >= 0x3B1 && cp <= 0x3CB) return cp - 0x20;
+    if (cp == 0x3CC) return 0x38C;
+    if (cp == 0x3CD || cp == 0x3CE) return cp - 0x3F;
+    if (cp >= 0x430 && cp <= 0x44F) return cp - 0x20;
+    if (cp >= 0x450 && cp <= 0x45F) return cp - 0x50;
+    return cp;
+}
+
+// Inverse of unicode_upper over the same ranges
+uint32_t unicode_lower(uint32_t cp) {
+    if (cp < 0x80) return tolower(cp);
+    if (cp >= 0xC0 && cp <= 0xDE && cp != 0xD7) return cp + 0x20;
+    if (cp == 0x178) return 0xFF;
+    if (cp >= 0x100 && cp <= 0x137 && !(cp & 1)) return cp + 1;
+    if (cp >= 0x139 && cp <= 0x148 && (cp & 1)) return cp + 1;
+    if (cp >= 0x14A && cp <= 0x177 && !(cp & 1)) return cp + 1;
+    if (cp >= 0x179 && cp <= 0x17E && (cp & 1)) return cp + 1;
+    if (cp == 0x386) return 0x3AC;
+    if (cp >= 0x388 && cp <= 0x38A) return cp + 0x25;
+    if (cp == 0x38C) return 0x3CC;
+    if (cp == 0x38E || cp == 0x38F) return cp + 0x3F;
+    if (cp >= 0x391 && cp <= 0x3AB && cp != 0x3A2) return cp + 0x20;
+    if (cp >= 0x410 && cp <= 0x42F) return cp + 0x20;
+    if (cp >= 0x400 && cp <= 0x40F) return cp + 0x50;
+    return cp;
+}
+
+static std::u32string utf8_codepoints(const char* s, size_t len) {
+    std::u32string out;
+    out.reserve(len);
+    for (size_t i=0; i<len;) {
+        uint32_t cp;
+        i += utf8_decode(&s[i], len - i, &cp);
+        out.push_back(cp);
+    }
+    return out;
+}
+
+// Calls f with the position and byte length of every character that can be removed from s
+// Make sure we don't repeat deletes e.g. apple -> aple and aple
+template <typename F>
+static void for_each_delete_at(const char* s, size_t s_len, bool wide, F f) {
+    const char* last = nullptr;
+    size_t last_len = 0;
+    for (size_t i=0; i<s_len;) {
+        uint32_t cp;
+        size_t n = wide ? utf8_decode(&s[i], s_len - i, &cp) : 1;
+
+        // Single character words don't need to be considered here
+        if (n == s_len) return;
+
+        if (!(last_len == n && memcmp(last, &s[i], n) == 0)) {
+            f(i, n);
+        }
+        last = &s[i];
+        last_len = n;
+        i += n;
+    }
+}
+
+// Calls f with every string that has one character removed from s
+template <typename F>
+static void for_each_delete(const char* s, size_t s_len, bool wide, F f) {
+    std::string buf;
+    for_each_delete_at(s, s_len, wide, [&](size_t i, size_t n) {
+        buf.assign(s, i);
+        buf.append(&s[i + n], s_len - i - n);
+        f(buf);
+    });
+}
+
+Sym_Spell::Sym_Spell(const char* dict_text, size_t text_len, bool utf8)
+    : utf8(utf8), loaded(false) {
 
     std::string s = std::string(dict_text, text_len);
 
@@ -27,6 +257,10 @@ Sym_Spell::Sym_Spell(const char* dict_text, size_t text_len) {
     capitals = (char*)calloc(text_len, sizeof(char));
     memcpy(data, dict_text, (text_len)*sizeof(char));
     memcpy(capitals, data, (text_len)*sizeof(char));
+    if (utf8) {
+        wide_words = std::vector<bool>(text_len);
+        mark_wide_words(data, text_len, wide_words);
+    }
 
     const char* c = data;
     char* d = capitals;
@@ -43,7 +277,17 @@ Sym_Spell::Sym_Spell(const char* dict_text, size_t text_len) {
             //     printf("%s %lu\n", c, str_len);
             // }
 
-            if (islower(c[0])) {
+            if (utf8 && ((unsigned char)c[0] & 0x80)) {
+                // Only swap the first codepoint when the encoding keeps the same length
+                uint32_t cp;
+                size_t n = utf8_decode(c, str_len, &cp);
+                uint32_t upper = unicode_upper(cp);
+                char buf[4];
+                if (upper != cp && utf8_encode(upper, buf) == n && wide_words[c - data]) {
+                    memcpy(d, buf, n);
+                    insert(d, str_len);
+                }
+            } else if (islower(c[0])) {
                 d[0] = toupper(c[0]);
                 insert(d, str_len);
             }
@@ -56,6 +300,17 @@ Sym_Spell::Sym_Spell(const char* dict_text, size_t text_len) {
         }
         str_len++;
     }
+    build_probe();
+}
+
+Sym_Spell::Sym_Spell(Sym_Spell&& other)
+    : dict(std::move(other.dict)), map(std::move(other.map)),
+      data(other.data), capitals(other.capitals), filesize(other.filesize), utf8(other.utf8),
+      loaded(other.loaded), probe(std::move(other.probe)), probe_entries(std::move(other.probe_entries)),
+      probe_hashes(std::move(other.probe_hashes)), wide_words(std::move(other.wide_words)) {
+    other.data = nullptr;
+    other.capitals = nullptr;
+    other.filesize = 0;
 }
 
 Sym_Spell::~Sym_Spell() {
@@ -63,6 +318,179 @@ Sym_Spell::~Sym_Spell() {
     free(data);
 }
 
+// Bumped whenever the layout changes so older shards get rebuilt instead of misread
+#define SHARD_MAGIC 0x53594d32u
+
+// Words point into data or capitals, so they're stored as offsets with capitals after data
+// 32 bits covers both for any partition under 2GB, which save checks
+static uint32_t shard_offset(const Sym_Spell& sym, const char* word) {
+    if (word >= sym.data && word < sym.data + sym.filesize) return word - sym.data;
+    return sym.filesize + (word - sym.capitals);
+}
+
+// Writes the built index so a restarted run can skip generating deletes
+// Goes through a temporary file like the round checkpoints, opened first so a bad path fails before serialising
+bool Sym_Spell::save(const char* filename) {
+    if (2*filesize > UINT32_MAX) return false;
+    std::string tmp = std::string(filename) + ".tmp";
+    FILE* f = fopen(tmp.c_str(), "wb");
+    if (!f) return false;
+
+    // Serialise into one buffer, writing entry by entry is dominated by stdio overhead
+    std::vector<char> out;
+    out.reserve(2*filesize + map.size()*32);
+    auto put = [&](const void* p, size_t n) {
+        out.insert(out.end(), (const char*)p, (const char*)p + n);
+    };
+
+    uint32_t magic = SHARD_MAGIC;
+    uint8_t wide = utf8;
+    uint64_t len = filesize;
+    put(&magic, sizeof(magic));
+    put(&wide, sizeof(wide));
+    put(&len, sizeof(len));
+    put(data, filesize);
+    put(capitals, filesize);
+
+    // The dictionary set isn't saved, it's every word in data and capitals
+    // probe_entries lists the map's nodes in the order they were allocated, which walks memory far
+    // more sequentially than the map's own bucket order
+    uint64_t map_count = map.size();
+    put(&map_count, sizeof(map_count));
+    auto put_entry = [&](const std::string& key, const std::vector<const char*>& words) {
+        uint32_t key_len = key.size();
+        uint32_t word_count = words.size();
+        put(&key_len, sizeof(key_len));
+        put(key.data(), key_len);
+        put(&word_count, sizeof(word_count));
+        for (const char* word : words) {
+            uint32_t offset = shard_offset(*this, word);
+            put(&offset, sizeof(offset));
+        }
+    };
+    if (probe_entries.size() == map.size()) {
+        for (const Map_Entry* entry : probe_entries) put_entry(entry->first, entry->second);
+    } else {
+        for (const Map_Entry& entry : map) put_entry(entry.first, entry.second);
+    }
+
+    bool ok = fwrite(out.data(), 1, out.size(), f) == out.size();
+    ok = (fclose(f) == 0) && ok;
+    if (!ok || rename(tmp.c_str(), filename) != 0) {
+        remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Replaces the index with one saved from the same dictionary text, returns false if it doesn't match
+bool Sym_Spell::load(const char* filename, const char* dict_text, size_t text_len) {
+    FILE* f = fopen(filename, "rb");
+    if (!f) return false;
+    fseek(f, 0, SEEK_END);
+    long in_len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    std::vector<char> in = std::vector<char>(in_len > 0 ? in_len : 0);
+    bool ok = in_len > 0 && fread(in.data(), 1, in.size(), f) == in.size();
+    fclose(f);
+
+    size_t pos = 0;
+    auto get = [&](void* p, size_t n) {
+        ok = ok && in.size() - pos >= n;
+        if (ok) {
+            memcpy(p, &in[pos], n);
+            pos += n;
+        }
+        return ok;
+    };
+
+    uint32_t magic = 0;
+    uint8_t wide = 0;
+    uint64_t len = 0;
+    get(&magic, sizeof(magic));
+    get(&wide, sizeof(wide));
+    get(&len, sizeof(len));
+    if (!ok || magic != SHARD_MAGIC || wide != utf8 || len != text_len) return false;
+
+    char* new_data = (char*)calloc(text_len, sizeof(char));
+    char* new_capitals = (char*)calloc(text_len, sizeof(char));
+    get(new_data, text_len);
+    get(new_capitals, text_len);
+
+    // The shard has to come from exactly this partition of the dictionary
+    for (size_t i=0; ok && i<text_len; i++) {
+        char c = dict_text[i] == '\n' ? '\0' : dict_text[i];
+        if (new_data[i] != c) ok = false;
+    }
+
+    auto new_dict = std::unordered_set<std::string>();
+    auto new_map = std::unordered_map<std::string, std::vector<const char*>, String_Hasher>();
+    auto new_entries = std::vector<const Map_Entry*>();
+    auto new_hashes = std::vector<size_t>();
+    std::string buf;
+
+    // Capitalised variants sit at the same offset as their word, or repeat it when there isn't one
+    size_t word_begin = 0;
+    for (size_t i=0; ok && i<text_len; i++) {
+        if (new_data[i] != '\0') continue;
+        new_dict.emplace(&new_data[word_begin], i - word_begin);
+        new_dict.emplace(&new_capitals[word_begin], i - word_begin);
+        word_begin = i + 1;
+    }
+
+    uint64_t map_count = 0;
+    get(&map_count, sizeof(map_count));
+    new_map.reserve(map_count);
+    new_entries.reserve(map_count);
+    new_hashes.reserve(map_count);
+    for (uint64_t i=0; ok && i<map_count; i++) {
+        uint32_t key_len = 0;
+        uint32_t word_count = 0;
+        get(&key_len, sizeof(key_len));
+        buf.resize(ok ? key_len : 0);
+        get(&buf[0], key_len);
+        get(&word_count, sizeof(word_count));
+        if (!ok) break;
+
+        std::vector<const char*> words = std::vector<const char*>(word_count);
+        for (uint32_t k=0; ok && k<word_count; k++) {
+            uint32_t offset = 0;
+            get(&offset, sizeof(offset));
+            if (offset >= 2*text_len) {
+                ok = false;
+                break;
+            }
+            words[k] = offset < text_len ? &new_data[offset] : &new_capitals[offset - text_len];
+        }
+        auto it = new_map.emplace(buf, std::move(words)).first;
+        new_entries.push_back(&*it);
+        new_hashes.push_back(fnv_hash_bytes(FNV_OFFSET_BASIS, buf.data(), buf.size()));
+    }
+
+    if (!ok) {
+        free(new_data);
+        free(new_capitals);
+        return false;
+    }
+
+    free(data);
+    free(capitals);
+    data = new_data;
+    capitals = new_capitals;
+    filesize = text_len;
+    dict = std::move(new_dict);
+    map = std::move(new_map);
+    if (utf8) {
+        wide_words = std::vector<bool>(text_len);
+        mark_wide_words(data, text_len, wide_words);
+    }
+    probe_entries = std::move(new_entries);
+    probe_hashes = std::move(new_hashes);
+    build_probe();
+    loaded = true;
+    return true;
+}
+
 void Sym_Spell::insert(const char* s, size_t s_len) {
 
     // std::string str =std::string(s, s_len);
@@ -72,40 +500,81 @@ void Sym_Spell::insert(const char* s, size_t s_len) {
     // }
     if (dict.count(s)) return;
 
+    // The probe table only covers what was in the map when it was built
+    probe.clear();
+
     // Insert word into dictionary
     dict.insert(s);
 
     // Create new list for word
-    if (map.count(s)) {
-        map[s].push_back(s);
-    } else {
-        std::vector<const char*> new_list = {s};
-        map[s] = new_list; 
-    }
+    add(std::string(s, s_len), s);
 
     // Single character words don't need to be considered here
     if (s_len < 2) return;
 
     // Insert the string with one character removed for every character in the string
-    // Make sure we don't insert duplicates e.g. apple -> inserting aple and aple
-    std::string buf = std::string(s, s_len);
-    char last = '\0';
-    for (size_t i=0; i<s_len; i++) {
-        if (last == s[i]) continue;
-        buf.erase(i, 1);
-        if (map.count(buf)) {
-            map[buf].push_back(s);
+    for_each_delete(s, s_len, word_wide(s, s_len), [&](const std::string& buf) {
+        add(buf, s);
+    });
+}
+
+// Appends word to the list for key, remembering new keys for the probe table
+void Sym_Spell::add(const std::string& key, const char* word) {
+    auto [it, added] = map.try_emplace(key);
+    it->second.push_back(word);
+    if (added) {
+        probe_entries.push_back(&*it);
+        probe_hashes.push_back(fnv_hash_bytes(FNV_OFFSET_BASIS, key.data(), key.size()));
+    }
+}
+
+// Case folded spellings of a non-ASCII word in UTF-8 mode, all lowercase then capitalised
+// ASCII words are left alone so they keep the byte path and its results
+std::vector<std::string> Sym_Spell::folds(const char* s, size_t s_len) {
+    auto out = std::vector<std::string>();
+    if (!wide(s, s_len)) return out;
+
+    std::string lower;
+    std::string title;
+    lower.reserve(s_len);
+    char buf[4];
+    for (size_t i=0; i<s_len;) {
+        uint32_t cp;
+        size_t n = utf8_decode(&s[i], s_len - i, &cp);
+
+        // Keep characters whose other case has a different encoded length
+        uint32_t l = unicode_lower(cp);
+        if (utf8_encode(l, buf) == n) {
+            lower.append(buf, n);
         } else {
-            std::vector<const char*> new_list = {s};
-            map[buf] = new_list;
+            lower.append(&s[i], n);
         }
-        last = s[i];
-        buf = s;
+
+        if (i == 0) {
+            uint32_t u = unicode_upper(l);
+            if (utf8_encode(u, buf) == n) {
+                title.append(buf, n);
+            } else {
+                title.append(&s[i], n);
+            }
+        } else {
+            title.append(&lower[i], n);
+        }
+        i += n;
     }
+
+    if (lower != std::string(s, s_len)) out.push_back(lower);
+    if (title != lower && title != std::string(s, s_len)) out.push_back(title);
+    return out;
 }
 
 bool Sym_Spell::check(const char* s, size_t s_len) {
-    return (bool)dict.count(s);
+    if (dict.count(s)) return true;
+    if (!utf8) return false;
+    for (const std::string& f : folds(s, s_len)) {
+        if (dict.count(f)) return true;
+    }
+    return false;
 }
 
 
@@ -113,57 +582,352 @@ std::vector<const char*> Sym_Spell::candidates(const char* s, size_t s_len) {
     assert(!check(s, s_len));
 
     auto out = std::vector<const char*>();
+    candidates_of(s, s_len, out);
+    if (utf8) {
+        for (const std::string& f : folds(s, s_len)) {
+            candidates_of(f.c_str(), f.size(), out);
+        }
+    }
+    return out;
+}
+
+void Sym_Spell::candidates_of(const char* s, size_t s_len, std::vector<const char*>& out) {
 
     // Check original word
 
-    if (map.count(s)) {
-        for (const char* word: map[s]) {
+    // find rather than operator[], the index may be read by the shard save at the same time
+    auto exact = map.find(s);
+    if (exact != map.end()) {
+        for (const char* word: exact->second) {
             out.push_back(word);
         }
     }
 
-    char last = '\0';
-
     // Check word with deletions
 
-    if (s_len < 2) return out;
-
-    for (size_t i=0; i<s_len; i++) {
-
-        // Deleting same character as the previous loop
-        if (last == s[i]) continue;
+    if (s_len < 2) return;
 
-        std::string buf = s;
-        buf.erase(i, 1);
+    bool s_wide = wide(s, s_len);
+    for_each_delete(s, s_len, s_wide, [&](const std::string& buf) {
 
         // No potential mispelling here
-        if (!map.count(buf)) {
-            last = s[i];
-            continue;
-        }
+        auto it = map.find(buf);
+        if (it == map.end()) return;
 
         // Sort out candidate words
-        for (const char* word : map[buf]) {
-            if (edit_distance(s, word) != 1) continue; 
+        for (const char* word : it->second) {
+            if (edit_distance(s, s_len, s_wide, word) != 1) continue;
             out.push_back(word);
         }
-
-        last = s[i];
-        buf = s;
-    }
+    });
     // Sort words in the list
     // std::sort(out.begin(), out.end(), [](const char* &lhs, const char* &rhs){
     //     return strcmp(lhs, rhs) <= 0;
     // });
-    return out;
 }
 
 std::vector<const char*> Sym_Spell::candidates(const std::string &s) {
     return candidates(s.c_str(), s.length());
 }
 
+// Orders words ignoring case, putting lowercase first among capitalised variants
+int word_order(const char* lhs, const char* rhs) {
+    int c = strcasecmp(lhs, rhs);
+    if (c != 0) return c;
+    return -strcmp(lhs, rhs);
+}
+
+// Smallest candidate is picked so every rank agrees on the same correction
+unsigned char Sym_Spell::lookup(const char* s, size_t s_len, const char** best) {
+    if (check(s, s_len)) return LOOKUP_EXACT;
+
+    auto words = candidates(s, s_len);
+    if (words.empty()) return LOOKUP_NONE;
+
+    if (best) {
+        *best = *std::min_element(words.begin(), words.end(), [](const char* lhs, const char* rhs) {
+            return word_order(lhs, rhs) < 0;
+        });
+    }
+    return LOOKUP_EDIT;
+}
+
+// costs[i*SEGMENT_MAX_LEN + n - 1] holds the lookup result for text[i..i+n)
+// bounds[i] is set where the input had a word boundary, always at 0 and len, SEGMENT_HARD ones are kept
+// Corrections cost SEGMENT_EDIT and unknown words SEGMENT_UNKNOWN per character, or the SEGMENT_SPLIT_
+// costs when the segment isn't one of the input's words, and every boundary added to or removed from
+// the input costs SEGMENT_BOUNDARY, so a known word is never split up
+// Ties go to the segmentation that changes fewer boundaries
+std::vector<Segment> segment(const char* text, size_t len, const unsigned char* costs, const char* bounds, bool utf8) {
+    std::vector<size_t> score(len + 1, SIZE_MAX);
+    std::vector<size_t> changes(len + 1, SIZE_MAX);
+    std::vector<size_t> prev(len + 1, 0);
+    std::vector<unsigned char> kind(len + 1, LOOKUP_NONE);
+    score[0] = 0;
+    changes[0] = 0;
+
+    // Running counts of characters and inner boundaries, so any segment is priced without rescanning it
+    // word_start is the start of the input word a position belongs to, lets long words be kept whole
+    std::vector<size_t> word_start(len + 1, 0);
+    std::vector<size_t> chars(len + 1, 0);
+    std::vector<size_t> soft(len + 1, 0);
+    std::vector<size_t> hard(len + 1, 0);
+    for (size_t k=1; k<=len; k++) {
+        word_start[k] = bounds[k - 1] ? k - 1 : word_start[k - 1];
+        chars[k] = chars[k - 1] + !(utf8 && ((unsigned char)text[k - 1] & 0xC0) == 0x80);
+        soft[k] = soft[k - 1] + (k < len && bounds[k] == SEGMENT_SOFT);
+        hard[k] = hard[k - 1] + (k < len && bounds[k] == SEGMENT_HARD);
+    }
+
+    auto relax = [&](size_t i, size_t j, unsigned char cost) {
+        if (score[i] == SIZE_MAX || hard[j - 1] != hard[i]) return;
+
+        // Input boundaries removed inside the segment, plus one added at its end
+        size_t c = changes[i] + soft[j - 1] - soft[i];
+        if (j < len && !bounds[j]) c++;
+
+        size_t sc = score[i] + SEGMENT_BOUNDARY * (c - changes[i]);
+        bool input_word = bounds[i] && bounds[j] && soft[j - 1] == soft[i];
+        if (cost == LOOKUP_EDIT) sc += input_word ? SEGMENT_EDIT : SEGMENT_SPLIT_EDIT;
+        if (cost == LOOKUP_NONE) sc += (input_word ? SEGMENT_UNKNOWN : SEGMENT_SPLIT_UNKNOWN) * (chars[j] - chars[i]);
+        if (sc < score[j] || (sc == score[j] && c < changes[j])) {
+            score[j] = sc;
+            changes[j] = c;
+            prev[j] = i;
+            kind[j] = cost;
+        }
+    };
+
+    for (size_t j=1; j<=len; j++) {
+
+        // Don't end a segment in the middle of a codepoint
+        if (utf8 && j < len && ((unsigned char)text[j] & 0xC0) == 0x80) continue;
+
+        size_t lo = j > SEGMENT_MAX_LEN ? j - SEGMENT_MAX_LEN : 0;
+        for (size_t i=lo; i<j; i++) {
+            relax(i, j, costs[i*SEGMENT_MAX_LEN + (j - i) - 1]);
+        }
+
+        // Past SEGMENT_MAX_LEN only the input word itself is considered, as an unknown word
+        size_t i = word_start[j];
+        if (j - i > SEGMENT_MAX_LEN && bounds[j]) relax(i, j, LOOKUP_NONE);
+    }
+
+    auto out = std::vector<Segment>();
+    for (size_t j=len; j>0; j=prev[j]) {
+        out.push_back({prev[j], j - prev[j], kind[j]});
+    }
+    std::reverse(out.begin(), out.end());
+    return out;
+}
+
+#define PROBE_EMPTY UINT32_MAX
+
+// Maps the low half of a hash onto the table, which isn't a power of two so a mask won't do
+inline size_t Sym_Spell::probe_slot(size_t hash) {
+    return ((hash & 0xffffffff) * probe.size()) >> 32;
+}
+
+// Hashes the same way as String_Hasher so either can be used on a key
+// Sized at 1.3 slots a key, on dict100000 that is ~14MB of slots plus ~11MB of entry pointers
+void Sym_Spell::build_probe() {
+    probe = std::vector<Probe_Slot>(map.size() + map.size()*3/10 + 1, Probe_Slot{0, PROBE_EMPTY});
+
+    // Keys are hashed as they're added, walking the map's nodes instead is dominated by cache misses
+    // Only falls back to that when something bypassed add
+    if (probe_hashes.size() != map.size() || probe_entries.size() != map.size()) {
+        probe_entries.clear();
+        probe_hashes.clear();
+        for (const Map_Entry& entry : map) {
+            probe_entries.push_back(&entry);
+            probe_hashes.push_back(fnv_hash_bytes(FNV_OFFSET_BASIS, entry.first.data(), entry.first.size()));
+        }
+    }
+
+    // Prefetch the scattered writes a group ahead
+    for (size_t k=0; k<probe_hashes.size(); k++) {
+        if (k + PREFETCH_GROUP < probe_hashes.size()) {
+            __builtin_prefetch(&probe[probe_slot(probe_hashes[k + PREFETCH_GROUP])], 1);
+        }
+        size_t slot = probe_slot(probe_hashes[k]);
+        while (probe[slot].index != PROBE_EMPTY) {
+            if (++slot == probe.size()) slot = 0;
+        }
+        probe[slot] = {(uint32_t)(probe_hashes[k] >> 32), (uint32_t)k};
+    }
+    probe_hashes = std::vector<size_t>();
+}
+
+// Probes in groups, prefetching the slots of the next group while walking this one
+// Matches are on the hash's tag alone, callers check the key and fall back to the map on a collision
+void Sym_Spell::find_batch(const size_t* hashes, const Map_Entry** entries, size_t count) {
+    for (size_t k=0; k<std::min(count, (size_t)PREFETCH_GROUP); k++) {
+        __builtin_prefetch(&probe[probe_slot(hashes[k])]);
+    }
+
+    for (size_t g=0; g<count; g+=PREFETCH_GROUP) {
+        size_t end = std::min(count, g + PREFETCH_GROUP);
+        for (size_t k=end; k<std::min(count, end + PREFETCH_GROUP); k++) {
+            __builtin_prefetch(&probe[probe_slot(hashes[k])]);
+        }
+
+        for (size_t k=g; k<end; k++) {
+            size_t slot = probe_slot(hashes[k]);
+            uint32_t tag = hashes[k] >> 32;
+            entries[k] = nullptr;
+            while (probe[slot].index != PROBE_EMPTY) {
+                if (probe[slot].tag == tag) {
+                    entries[k] = probe_entries[probe[slot].index];
+                    __builtin_prefetch(entries[k]);
+                    break;
+                }
+                if (++slot == probe.size()) slot = 0;
+            }
+        }
+    }
+}
+
+// Key of an entry compared against s with bytes [cut, cut + cut_len) removed
+static bool key_matches(const std::string& key, const char* s, size_t s_len, size_t cut, size_t cut_len) {
+    if (key.size() != s_len - cut_len) return false;
+    return memcmp(key.data(), s, cut) == 0
+        && memcmp(key.data() + cut, s + cut + cut_len, s_len - cut - cut_len) == 0;
+}
+
+void Sym_Spell::check_batch(const Word_Batch& batch, bool* found) {
+    if (probe.empty()) build_probe();
+
+    std::vector<size_t> hashes;
+    std::vector<const Map_Entry*> entries;
+    for (int c=0; c<batch.count; c+=BATCH_CHUNK) {
+        int end = std::min(batch.count, c + BATCH_CHUNK);
+
+        // Stage 1: hash every word
+        hashes.resize(end - c);
+        for (int j=c; j<end; j++) {
+            hashes[j - c] = fnv_hash_bytes(FNV_OFFSET_BASIS, &batch.data[batch.offsets[j]], batch.lengths[j]);
+        }
+
+        // Stage 2: probe
+        entries.resize(end - c);
+        find_batch(hashes.data(), entries.data(), end - c);
+
+        // Stage 3: a dictionary word is always in its own list
+        for (int j=c; j<end; j++) {
+            const char* s = &batch.data[batch.offsets[j]];
+            size_t s_len = batch.lengths[j];
+            const Map_Entry* entry = entries[j - c];
+            if (entry && !key_matches(entry->first, s, s_len, 0, 0)) {
+                found[j] = check(s, s_len);
+                continue;
+            }
+            found[j] = false;
+            if (entry) {
+                for (const char* word : entry->second) {
+                    if (strncmp(word, s, s_len) == 0 && word[s_len] == '\0') {
+                        found[j] = true;
+                        break;
+                    }
+                }
+            }
+
+            // Case folding only ever applies to non-ASCII words, which take the slow path
+            if (!found[j] && wide(s, s_len)) found[j] = check(s, s_len);
+        }
+    }
+}
+
+void Sym_Spell::candidates_batch(const Word_Batch& batch, const bool* skip, std::vector<const char*>* out) {
+    if (probe.empty()) build_probe();
+
+    // One row per variant, the word itself has cut_len 0
+    std::vector<int> owner;
+    std::vector<uint32_t> cut;
+    std::vector<uint32_t> cut_len;
+    std::vector<size_t> hashes;
+    std::vector<size_t> prefix;
+    std::vector<const Map_Entry*> entries;
+    std::vector<char> word_is_wide;
+
+    for (int c=0; c<batch.count; c+=BATCH_CHUNK) {
+        int end = std::min(batch.count, c + BATCH_CHUNK);
+        owner.clear();
+        cut.clear();
+        cut_len.clear();
+        hashes.clear();
+        word_is_wide.assign(end - c, 0);
+
+        // Stage 1: hash the word and all its deletes, reusing the hash of the prefix before each cut
+        for (int j=c; j<end; j++) {
+            if (skip && skip[j]) continue;
+            out[j].clear();
+
+            const char* s = &batch.data[batch.offsets[j]];
+            size_t s_len = batch.lengths[j];
+            prefix.resize(s_len + 1);
+            prefix[0] = FNV_OFFSET_BASIS;
+            for (size_t k=0; k<s_len; k++) {
+                prefix[k + 1] = (prefix[k] ^ s[k]) * FNV_PRIME;
+            }
+
+            owner.push_back(j);
+            cut.push_back(0);
+            cut_len.push_back(0);
+            hashes.push_back(prefix[s_len] % (UINT64_MAX / 2));
+
+            if (s_len < 2) continue;
+            word_is_wide[j - c] = wide(s, s_len);
+            for_each_delete_at(s, s_len, word_is_wide[j - c], [&](size_t i, size_t n) {
+                size_t hash = prefix[i];
+                for (size_t k=i+n; k<s_len; k++) {
+                    hash = (hash ^ s[k]) * FNV_PRIME;
+                }
+                owner.push_back(j);
+                cut.push_back(i);
+                cut_len.push_back(n);
+                hashes.push_back(hash % (UINT64_MAX / 2));
+            });
+        }
+
+        // Stage 2: probe
+        entries.resize(hashes.size());
+        find_batch(hashes.data(), entries.data(), hashes.size());
+
+        // Stage 3: verify keys, then candidates the same way as the per word path
+        for (size_t k=0; k<hashes.size(); k++) {
+            int j = owner[k];
+            const char* s = &batch.data[batch.offsets[j]];
+            size_t s_len = batch.lengths[j];
+            const Map_Entry* entry = entries[k];
+
+            if (entry && !key_matches(entry->first, s, s_len, cut[k], cut_len[k])) {
+                std::string key = std::string(s, cut[k]);
+                key.append(&s[cut[k] + cut_len[k]], s_len - cut[k] - cut_len[k]);
+                auto it = map.find(key);
+                entry = it == map.end() ? nullptr : &*it;
+            }
+            if (!entry) continue;
+
+            for (const char* word : entry->second) {
+                if (cut_len[k] != 0 && edit_distance(s, s_len, word_is_wide[j - c], word) != 1) continue;
+                out[j].push_back(word);
+            }
+        }
+
+        // Case folded spellings of non-ASCII words go through the per word path
+        if (!utf8) continue;
+        for (int j=c; j<end; j++) {
+            if (skip && skip[j]) continue;
+            for (const std::string& f : folds(&batch.data[batch.offsets[j]], batch.lengths[j])) {
+                candidates_of(f.c_str(), f.size(), out[j]);
+            }
+        }
+    }
+}
+
 // copied from skeleton
-size_t Sym_Spell::edit_distance(const std::string& s1, const std::string& s2) {
+template <typename S>
+static size_t levenshtein(const S& s1, const S& s2) {
   const size_t m = s1.size();
   const size_t n = s2.size();
 
@@ -197,4 +961,25 @@ size_t Sym_Spell::edit_distance(const std::string& s1, const std::string& s2) {
         }
     }
     return dp[m][n];
-}
\ No newline at end of file
+}
+
+bool Sym_Spell::wide(const char* s, size_t s_len) {
+    return utf8 && !ascii_only(s, s_len) && utf8_valid(s, s_len);
+}
+
+// Dictionary words use the flags from ingestion, anything else is validated here
+bool Sym_Spell::word_wide(const char* s, size_t s_len) {
+    if (!utf8) return false;
+    if (s >= data && s < data + filesize) return wide_words[s - data];
+    if (s >= capitals && s < capitals + filesize) return wide_words[s - capitals];
+    return wide(s, s_len);
+}
+
+// s is the query, validated once by the caller, word is always a dictionary word
+size_t Sym_Spell::edit_distance(const char* s, size_t s_len, bool s_wide, const char* word) {
+    size_t word_len = strlen(word);
+    if (s_wide || word_wide(word, word_len)) {
+        return levenshtein(utf8_codepoints(s, s_len), utf8_codepoints(word, word_len));
+    }
+    return levenshtein(std::string_view(s, s_len), std::string_view(word, word_len));
+}
@@ -13,7 +13,44 @@
 #define SIZE_TEMP 5
 #define RESIZE_FACTOR 3
 
+// Longest substring considered as a single word during segmentation
+#define SEGMENT_MAX_LEN 24
+// Room for a candidate one character (up to 4 bytes in UTF-8) longer than the segment plus the null byte
+#define SEGMENT_SLOT (SEGMENT_MAX_LEN + 5)
+// Segmentation costs, changing a boundary has to cost more than correcting one of the input's words
+// Unknown words cost per character, so splitting one into known words pays off once they average over
+// four characters
+// Pieces of a split or join cost more when corrected or unknown, or a run-on would rather become near
+// misses and leftovers than known words
+#define SEGMENT_EDIT 5
+#define SEGMENT_BOUNDARY 8
+#define SEGMENT_UNKNOWN 2
+#define SEGMENT_SPLIT_EDIT 10
+#define SEGMENT_SPLIT_UNKNOWN 3
+// Boundary kinds in the bounds passed to segment, a hard one has punctuation and is never removed
+#define SEGMENT_SOFT 1
+#define SEGMENT_HARD 2
+
+// Deletion variants probed together, the next group is prefetched while this one is probed
+#define PREFETCH_GROUP 16
+// Words hashed and probed per pass of the batched queries, keeps the staging arrays in cache
+#define BATCH_CHUNK 1024
+
+// Lookup results, lower is better
+#define LOOKUP_EXACT 0
+#define LOOKUP_EDIT 1
+#define LOOKUP_NONE 2
+
 size_t fnv_hash(size_t prev_hash, char const* letter);
+size_t fnv_hash_bytes(size_t prev_hash, char const* bytes, size_t len);
+
+// UTF-8 helpers
+bool ascii_only(const char* s, size_t len);
+bool utf8_valid(const char* s, size_t len);
+size_t utf8_decode(const char* s, size_t len, uint32_t* cp);
+size_t utf8_encode(uint32_t cp, char* out);
+uint32_t unicode_upper(uint32_t cp);
+uint32_t unicode_lower(uint32_t cp);
 
 struct String_Hasher {
   size_t operator()(const std::string& s) const {
@@ -21,6 +58,32 @@ struct String_Hasher {
   }
 };
 
+struct Segment {
+  size_t begin;
+  size_t len;
+  unsigned char cost;
+};
+
+int word_order(const char* lhs, const char* rhs);
+std::vector<Segment> segment(const char* text, size_t len, const unsigned char* costs, const char* bounds, bool utf8);
+
+// Structure of arrays view over null terminated words, word j starts at data[offsets[j]]
+struct Word_Batch {
+  const char* data;
+  const int* offsets;
+  const int* lengths;
+  int count;
+};
+
+using Map_Entry = std::pair<const std::string, std::vector<const char*>>;
+
+// Open addressing table over the map's nodes, 8 bytes a slot so more of it stays in cache
+// tag is the top half of the key's hash, index points into probe_entries
+struct Probe_Slot {
+  uint32_t tag;
+  uint32_t index;
+};
+
 struct Line {
   int word_count;
   std::string line;
@@ -33,17 +96,47 @@ struct Sym_Spell {
   char* capitals;
   size_t filesize;
 
+  // Deletes and distances work on codepoints for non-ASCII words
+  bool utf8;
+
+  // Set when the index came from a saved shard rather than being built
+  bool loaded;
+
   // Spec Change
 
-  Sym_Spell(const char* dict_text, size_t text_len);
+  Sym_Spell(const char* dict_text, size_t text_len, bool utf8 = false);
+  Sym_Spell(Sym_Spell&& other);
+  Sym_Spell(const Sym_Spell&) = delete;
   ~Sym_Spell();
+  bool save(const char* filename);
+  bool load(const char* filename, const char* dict_text, size_t text_len);
   void insert(const char* s, size_t s_len);
   bool check(const char* s, size_t s_len);
   std::vector<const char*> candidates(const char* s, size_t s_len);
   std::vector<const char*> candidates(const std::string &s);
+  unsigned char lookup(const char* s, size_t s_len, const char** best);
+
+  // Batched versions of check and candidates, words with skip[j] set are left alone
+  void check_batch(const Word_Batch& batch, bool* found);
+  void candidates_batch(const Word_Batch& batch, const bool* skip, std::vector<const char*>* out);
 
   private:
-    size_t edit_distance(const std::string& s1, const std::string& s2);
+    std::vector<Probe_Slot> probe;
+    std::vector<const Map_Entry*> probe_entries;
+    // Hashes of probe_entries, only kept until the probe table is built
+    std::vector<size_t> probe_hashes;
+    // Set at the offset of every valid non-ASCII word in data, the same offset in capitals shares it
+    std::vector<bool> wide_words;
+
+    void add(const std::string& key, const char* word);
+    void build_probe();
+    size_t probe_slot(size_t hash);
+    void find_batch(const size_t* hashes, const Map_Entry** entries, size_t count);
+    bool wide(const char* s, size_t s_len);
+    bool word_wide(const char* s, size_t s_len);
+    std::vector<std::string> folds(const char* s, size_t s_len);
+    void candidates_of(const char* s, size_t s_len, std::vector<const char*>& out);
+    size_t edit_distance(const char* s, size_t s_len, bool s_wide, const char* word);
 };
 
 struct Word_List {